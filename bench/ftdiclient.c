@@ -1,64 +1,27 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdbool.h>
-#include <assert.h>
 #include <ftdi.h>
 
-#include "../common/intmath.h"
-
-#define SER_PIN 0
-#define CLK_PIN 1
+#include "seg7encoder.h"
+#include "seg7send.h"
 
 #define MAX_DIGITS 4
-#define SLEEPDELAY 20
 
 struct ftdi_context *g_ftdi = NULL;
 
-static unsigned char ftdi_buf = 0;
+static Seg7Encoder encoder;
 static unsigned int value_to_send = 1234;
 
 /* Utils */
-static void pinset(char index, bool high)
-{
-    if (high) {
-        ftdi_buf |= 1 << index;
-    } else {
-        ftdi_buf &= ~(1 << index);
-    }
-    ftdi_write_data(g_ftdi, &ftdi_buf, 1);
-}
-
-static void push_serial(bool high)
-{
-    pinset(CLK_PIN, false);
-    pinset(SER_PIN, high);
-    usleep(SLEEPDELAY);
-    pinset(CLK_PIN, true);
-    usleep(SLEEPDELAY);
-}
-
-static void push_digit(uint8_t digit, bool enable_dot)
+static int push_number(uint32_t val)
 {
-    assert(digit < 10);
-
-    push_serial(digit & 1);
-    push_serial(digit & (1 << 1));
-    push_serial(digit & (1 << 2));
-    push_serial(digit & (1 << 3));
-    push_serial(enable_dot);
-}
+    uint8_t samples[SEG7ENC_FRAME_SAMPLES(MAX_DIGITS)];
+    Seg7Frame frame = {0, val, 0};
+    size_t count;
 
-static void push_number(uint32_t val)
-{
-    int i;
-
-    // we start with an empty CLK to begin;
-    push_serial(false);
-
-    for (i = 0; i < MAX_DIGITS; i++) {
-        push_digit((val / int_pow10(MAX_DIGITS - i - 1)) % 10, false);
-        usleep(SLEEPDELAY);
-    }
+    count = seg7enc_frame(&encoder, samples, &frame);
+    return seg7send_paced(g_ftdi, samples, count, MAX_DIGITS);
 }
 
 
@@ -75,8 +38,15 @@ int main()
         return 1;
     }
     ftdi_set_bitmode(g_ftdi, 0xff, BITMODE_BITBANG);
+    seg7enc_init(&encoder, MAX_DIGITS);
     while (1) {
-        push_number(value_to_send);
+        ret = push_number(value_to_send);
+        if (ret < 0) {
+            fprintf(
+                stderr, "unable to write to ftdi device: %d (%s)\n",
+                ret, ftdi_get_error_string(g_ftdi));
+            return 1;
+        }
         usleep(1000 * 1000);
         value_to_send++;
     }
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+#include <ftdi.h>
+
+#include "seg7encoder.h"
+#include "seg7mailbox.h"
+#include "seg7send.h"
+
+/* Display daemon
+ *
+ * Owns the FTDI device and publishes a shared-memory mailbox (see
+ * seg7mailbox.h) so that any number of local processes can post values to the
+ * boards without fighting over the device.
+ *
+ * Each board uses a pair of FTDI pins: board 0 uses D0 (SER) and D1 (CLK),
+ * board 1 uses D2 and D3, etc. Up to 4 boards can be driven this way. Boards
+ * whose value changed during the same poll are sent their frame in parallel,
+ * in a single batch (see seg7encoder.h and seg7send.h).
+ *
+ * Usage: seg7d [display_count]
+ */
+
+#define DIGITS 4
+// How often we look at the mailbox. There's no point in going much faster
+// than the time it takes to send a frame.
+#define POLLDELAY 1000
+
+struct ftdi_context *g_ftdi = NULL;
+
+static Seg7Encoder encoder;
+static uint64_t last_sent[SEG7MAILBOX_MAX_DISPLAYS];
+static volatile sig_atomic_t running = 1;
+
+/* Utils */
+static uint32_t usecs_since(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+static void update_stats(Seg7Mailbox *mailbox, uint8_t board, uint64_t word, uint32_t elapsed)
+{
+    Seg7Stats *stats = &mailbox->stats[board];
+
+    atomic_store_explicit(&stats->last_value, seg7slot_value(word), memory_order_relaxed);
+    atomic_store_explicit(&stats->last_dotmask, seg7slot_dotmask(word), memory_order_relaxed);
+    atomic_store_explicit(&stats->last_batch_usecs, elapsed, memory_order_relaxed);
+    if (elapsed > atomic_load_explicit(&stats->max_batch_usecs, memory_order_relaxed)) {
+        atomic_store_explicit(&stats->max_batch_usecs, elapsed, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&stats->frames_sent, 1, memory_order_relaxed);
+}
+
+// Sends a frame to each board whose slot changed since the last time. Returns
+// false if the device can't be written to anymore.
+static bool send_changed_slots(Seg7Mailbox *mailbox, uint8_t display_count)
+{
+    uint8_t samples[SEG7ENC_BATCH_SAMPLES(DIGITS, SEG7MAILBOX_MAX_DISPLAYS)];
+    Seg7Frame frames[SEG7MAILBOX_MAX_DISPLAYS];
+    uint64_t words[SEG7MAILBOX_MAX_DISPLAYS];
+    uint8_t count = 0;
+    uint8_t i;
+    size_t sample_count;
+    struct timespec start;
+    uint32_t elapsed;
+    int ret;
+
+    for (i = 0; i < display_count; i++) {
+        words[count] = seg7mailbox_peek(mailbox, i);
+        if ((words[count] & SEG7SLOT_POSTED) && (words[count] != last_sent[i])) {
+            frames[count].board = i;
+            frames[count].value = seg7slot_value(words[count]);
+            frames[count].dotmask = seg7slot_dotmask(words[count]);
+            count++;
+        }
+    }
+    if (count == 0) {
+        return true;
+    }
+    sample_count = seg7enc_batch(&encoder, samples, frames, count);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = seg7send_paced(g_ftdi, samples, sample_count, DIGITS);
+    if (ret < 0) {
+        fprintf(
+            stderr, "unable to write to ftdi device: %d (%s)\n",
+            ret, ftdi_get_error_string(g_ftdi));
+        return false;
+    }
+    // The frames were sent together, so that's the time of the whole batch,
+    // not the time of any single frame.
+    elapsed = usecs_since(&start);
+    for (i = 0; i < count; i++) {
+        last_sent[frames[i].board] = words[i];
+        update_stats(mailbox, frames[i].board, words[i], elapsed);
+    }
+    return true;
+}
+
+static void stop(int signum)
+{
+    running = 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret;
+    int arg_count = 1;
+    uint8_t display_count;
+    Seg7Mailbox *mailbox;
+
+    if (argc > 1) {
+        arg_count = atoi(argv[1]);
+    }
+    if ((arg_count < 1) || (arg_count > SEG7MAILBOX_MAX_DISPLAYS)) {
+        fprintf(stderr, "display count must be between 1 and %d\n", SEG7MAILBOX_MAX_DISPLAYS);
+        return 1;
+    }
+    display_count = arg_count;
+
+    g_ftdi = ftdi_new();
+    ret = ftdi_usb_open(g_ftdi, 0x0403, 0x6014);
+    if (ret < 0) {
+        fprintf(
+            stderr, "unable to open ftdi device: %d (%s)\n",
+            ret, ftdi_get_error_string(g_ftdi));
+        return 1;
+    }
+    ftdi_set_bitmode(g_ftdi, 0xff, BITMODE_BITBANG);
+    seg7enc_init(&encoder, DIGITS);
+
+    mailbox = seg7mailbox_create(display_count, DIGITS);
+    if (mailbox == NULL) {
+        ftdi_free(g_ftdi);
+        return 1;
+    }
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    ret = 0;
+    while (running) {
+        if (!send_changed_slots(mailbox, display_count)) {
+            ret = 1;
+            break;
+        }
+        atomic_fetch_add_explicit(&mailbox->polls, 1, memory_order_relaxed);
+        usleep(POLLDELAY);
+    }
+
+    seg7mailbox_destroy(mailbox);
+    ftdi_usb_close(g_ftdi);
+    ftdi_free(g_ftdi);
+    return ret;
+}
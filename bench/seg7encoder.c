@@ -0,0 +1,143 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "seg7encoder.h"
+
+#define SER_BIT(board) (1 << ((board) * 2))
+#define CLK_BIT(board) (1 << ((board) * 2 + 1))
+// CLK and SER low on all boards. CLK high would give a rising edge, that is an
+// announce, to every board the first time we write to the device.
+#define IDLE_SAMPLE 0x00
+// Digits per entry of bcd_table
+#define BCD_DIGITS 4
+#define BCD_MODULO 10000
+
+// BCD form of each value, rightmost digit in the low nibble. Shared by all
+// encoders, filled by the first seg7enc_init().
+static uint16_t bcd_table[BCD_MODULO];
+static bool bcd_table_ready = false;
+
+static void encode_bit(uint8_t *dest, uint8_t board, bool high)
+{
+    uint8_t sample;
+
+    sample = IDLE_SAMPLE & ~(SER_BIT(board) | CLK_BIT(board));
+    if (high) {
+        sample |= SER_BIT(board);
+    }
+    dest[0] = sample;
+    dest[1] = sample | CLK_BIT(board);
+}
+
+// When merging, we only touch the pins of the board we're encoding, leaving
+// the frame of other boards already in `dest` alone.
+static uint8_t* put_samples(uint8_t *dest, const uint8_t *src, size_t len, uint8_t pins, bool merge)
+{
+    size_t i;
+
+    if (merge) {
+        for (i = 0; i < len; i++) {
+            dest[i] = (dest[i] & ~pins) | (src[i] & pins);
+        }
+    } else {
+        memcpy(dest, src, len);
+    }
+    return dest + len;
+}
+
+static size_t encode_frame(
+    const Seg7Encoder *encoder, uint8_t *dest, const Seg7Frame *frame, bool merge)
+{
+    uint8_t i;
+    uint8_t symbol;
+    uint8_t pins = encoder->board_pins[frame->board];
+    uint32_t value = frame->value;
+    uint16_t bcd = 0;
+    uint8_t *p;
+
+    p = put_samples(
+        dest, encoder->announces[frame->board], SEG7ENC_SAMPLES_PER_BIT, pins, merge);
+    // we start with the rightmost digit
+    for (i = 0; i < encoder->digits; i++) {
+        if (i % BCD_DIGITS == 0) {
+            bcd = bcd_table[value % BCD_MODULO];
+            value /= BCD_MODULO;
+        }
+        symbol = bcd & 0xf;
+        bcd >>= 4;
+        if (frame->dotmask & (1 << i)) {
+            symbol |= 0x10;
+        }
+        p = put_samples(
+            p, encoder->symbols[frame->board][symbol], SEG7ENC_SYMBOL_SAMPLES, pins, merge);
+    }
+    return p - dest;
+}
+
+static void init_bcd_table()
+{
+    uint16_t value;
+    uint16_t n;
+    uint8_t i;
+
+    for (value = 0; value < BCD_MODULO; value++) {
+        bcd_table[value] = 0;
+        n = value;
+        for (i = 0; i < BCD_DIGITS; i++) {
+            bcd_table[value] |= (n % 10) << (i * 4);
+            n /= 10;
+        }
+    }
+    bcd_table_ready = true;
+}
+
+void seg7enc_init(Seg7Encoder *encoder, uint8_t digits)
+{
+    uint8_t board;
+    uint8_t symbol;
+    uint8_t i;
+
+    if (!bcd_table_ready) {
+        init_bcd_table();
+    }
+    encoder->digits = digits;
+    for (board = 0; board < SEG7ENC_MAX_BOARDS; board++) {
+        encoder->board_pins[board] = SER_BIT(board) | CLK_BIT(board);
+        encode_bit(encoder->announces[board], board, false);
+        for (symbol = 0; symbol < 32; symbol++) {
+            for (i = 0; i < 5; i++) {
+                encode_bit(
+                    &encoder->symbols[board][symbol][i * SEG7ENC_SAMPLES_PER_BIT],
+                    board, symbol & (1 << i));
+            }
+        }
+    }
+}
+
+size_t seg7enc_frame(const Seg7Encoder *encoder, uint8_t *dest, const Seg7Frame *frame)
+{
+    return encode_frame(encoder, dest, frame, false);
+}
+
+size_t seg7enc_batch(
+    const Seg7Encoder *encoder, uint8_t *dest, const Seg7Frame *frames, size_t count)
+{
+    size_t i;
+    size_t res = 0;
+    uint8_t pins;
+    uint8_t batch_pins = 0;
+    uint8_t *batch = dest;
+
+    for (i = 0; i < count; i++) {
+        pins = encoder->board_pins[frames[i].board];
+        if ((res == 0) || (batch_pins & pins)) {
+            batch = dest + res;
+            res += encode_frame(encoder, batch, &frames[i], false);
+            batch_pins = pins;
+        } else {
+            encode_frame(encoder, batch, &frames[i], true);
+            batch_pins |= pins;
+        }
+    }
+    return res;
+}
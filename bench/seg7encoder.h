@@ -0,0 +1,62 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/* Sender-side frame encoder
+ *
+ * Encodes numbers into the pin states (samples) that have to be sent through
+ * SER and CLK for the board to receive them. A sample is a byte of pin states,
+ * the way FTDI bitbang mode takes them. Board n has SER on bit 2n and CLK on
+ * bit 2n+1, so up to 4 boards can share the 8 pins of a FTDI chip.
+ *
+ * Each digit is sent as a 5-bit symbol (4 bits for the digit, 1 for the dot),
+ * so there are only 32 possible symbols. We compute their waveform once, for
+ * each board, and a frame is then assembled by copying them one after the
+ * other. Digits come from a table holding the BCD form of 0 to 9999, so
+ * there's a single division per 4 digits rather than two per digit. No pow10,
+ * no bit-by-bit branching.
+ *
+ * Pins of boards that aren't part of a frame are held idle: CLK and SER low,
+ * which is also how FTDI pins start in bitbang mode. The only edges these
+ * boards can see are falling ones, when their own frame ended with CLK high,
+ * and boards only read rising edges. Frames for different boards can thus be
+ * sent in parallel, which is what seg7enc_batch() does.
+ */
+
+#define SEG7ENC_MAX_BOARDS 4
+// Two samples per bit: CLK low with SER set, then CLK high.
+#define SEG7ENC_SAMPLES_PER_BIT 2
+#define SEG7ENC_SYMBOL_SAMPLES (5 * SEG7ENC_SAMPLES_PER_BIT)
+// The empty "announce" bit, then a symbol per digit.
+#define SEG7ENC_FRAME_SAMPLES(digits) \
+    (SEG7ENC_SAMPLES_PER_BIT + (digits) * SEG7ENC_SYMBOL_SAMPLES)
+// Enough room for seg7enc_batch() to encode `count` frames.
+#define SEG7ENC_BATCH_SAMPLES(digits, count) ((count) * SEG7ENC_FRAME_SAMPLES(digits))
+
+typedef struct {
+    uint8_t board;
+    uint32_t value;
+    // Bit n enables the dot of the nth digit that is sent.
+    uint8_t dotmask;
+} Seg7Frame;
+
+typedef struct {
+    uint8_t digits;
+    // Pins (SER and CLK) belonging to each board.
+    uint8_t board_pins[SEG7ENC_MAX_BOARDS];
+    uint8_t announces[SEG7ENC_MAX_BOARDS][SEG7ENC_SAMPLES_PER_BIT];
+    // Indexed by symbol: digit in the low 4 bits, dot in the 5th.
+    uint8_t symbols[SEG7ENC_MAX_BOARDS][32][SEG7ENC_SYMBOL_SAMPLES];
+} Seg7Encoder;
+
+void seg7enc_init(Seg7Encoder *encoder, uint8_t digits);
+// Encodes `frame` into `dest`, which must have room for
+// SEG7ENC_FRAME_SAMPLES(digits). Returns the number of samples written.
+size_t seg7enc_frame(const Seg7Encoder *encoder, uint8_t *dest, const Seg7Frame *frame);
+// Encodes `count` frames into `dest`, which must have room for
+// SEG7ENC_BATCH_SAMPLES(digits, count). Consecutive frames for different
+// boards are sent in parallel. A frame for a board that's already part of
+// the current batch starts a new one, so frames for a given board are sent in
+// order. Returns the number of samples written.
+size_t seg7enc_batch(
+    const Seg7Encoder *encoder, uint8_t *dest, const Seg7Frame *frames, size_t count);
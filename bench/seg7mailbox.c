@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "seg7mailbox.h"
+
+static Seg7Mailbox* map_mailbox(int fd)
+{
+    Seg7Mailbox *res;
+
+    res = mmap(NULL, sizeof(Seg7Mailbox), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (res == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    return res;
+}
+
+Seg7Mailbox* seg7mailbox_create(uint8_t display_count, uint8_t digits)
+{
+    int fd;
+    Seg7Mailbox *res;
+
+    if (display_count > SEG7MAILBOX_MAX_DISPLAYS) {
+        fprintf(stderr, "at most %d displays are supported\n", SEG7MAILBOX_MAX_DISPLAYS);
+        return NULL;
+    }
+    fd = shm_open(SEG7MAILBOX_SHM_NAME, O_RDWR | O_CREAT, 0666);
+    if (fd < 0) {
+        perror("shm_open");
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(Seg7Mailbox)) < 0) {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+    res = map_mailbox(fd);
+    if (res == NULL) {
+        return NULL;
+    }
+    // Stale slots from a previous run would be sent right away, start clean.
+    memset(res, 0, sizeof(Seg7Mailbox));
+    res->display_count = display_count;
+    res->digits = digits;
+    // magic goes last so that producers never see a half-initialized mailbox
+    atomic_store_explicit(&res->magic, SEG7MAILBOX_MAGIC, memory_order_release);
+    return res;
+}
+
+Seg7Mailbox* seg7mailbox_open()
+{
+    int fd;
+    Seg7Mailbox *res;
+
+    fd = shm_open(SEG7MAILBOX_SHM_NAME, O_RDWR, 0);
+    if (fd < 0) {
+        perror("shm_open (is seg7d running?)");
+        return NULL;
+    }
+    res = map_mailbox(fd);
+    if (res == NULL) {
+        return NULL;
+    }
+    if (atomic_load_explicit(&res->magic, memory_order_acquire) != SEG7MAILBOX_MAGIC) {
+        fprintf(stderr, "mailbox isn't initialized\n");
+        seg7mailbox_close(res);
+        return NULL;
+    }
+    return res;
+}
+
+void seg7mailbox_close(Seg7Mailbox *mailbox)
+{
+    munmap(mailbox, sizeof(Seg7Mailbox));
+}
+
+void seg7mailbox_destroy(Seg7Mailbox *mailbox)
+{
+    seg7mailbox_close(mailbox);
+    shm_unlink(SEG7MAILBOX_SHM_NAME);
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/* Shared-memory mailbox between seg7d and its producers
+ *
+ * seg7d owns the FTDI device and the boards hooked to it. Producers don't talk
+ * to the device at all: they open this mailbox and store the value they want
+ * to see in the slot of the display they target. Posting a value is a single
+ * atomic store, nothing else. No lock, no syscall.
+ *
+ * seg7d polls the slots and sends a frame to a board only when its slot holds
+ * something different from what was last sent. When a producer posts faster
+ * than the daemon polls, intermediate values are simply overwritten: the
+ * latest value wins, which is what we want for a display.
+ *
+ * Stats are written by the daemon only. Producers (or seg7post -s) can read
+ * them any time.
+ */
+
+#define SEG7MAILBOX_SHM_NAME "/seg7d"
+#define SEG7MAILBOX_MAGIC 0x37474553 // "SEG7"
+#define SEG7MAILBOX_MAX_DISPLAYS 4
+
+// Slot words are packed as such:
+// bits 0-31: value to display
+// bits 32-39: dotmask
+// bit 63: a value was posted at all (a slot that was never posted stays 0)
+#define SEG7SLOT_POSTED (1ULL << 63)
+
+// Atomics that aren't lock-free are implemented with a lock that is local to
+// the process, which is useless in shared memory.
+_Static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "slots need lock-free 64-bit atomics");
+_Static_assert(ATOMIC_INT_LOCK_FREE == 2, "stats need lock-free 32-bit atomics");
+
+typedef struct {
+    // Each slot gets its own cache line so that producers don't bounce each
+    // other's lines around, nor the one holding the header (and polls, which
+    // the daemon increments all the time). The mapping is page aligned.
+    _Alignas(64) _Atomic uint64_t word;
+    uint8_t padding[56];
+} Seg7Slot;
+
+_Static_assert(sizeof(Seg7Slot) == 64, "slots must fill a cache line");
+
+typedef struct {
+    _Atomic uint32_t frames_sent;
+    _Atomic uint32_t last_value;
+    _Atomic uint32_t last_dotmask;
+    // Time it took to send the batch that held this display's last frame.
+    // Displays that changed during the same poll share a batch, and its time.
+    _Atomic uint32_t last_batch_usecs;
+    _Atomic uint32_t max_batch_usecs;
+} Seg7Stats;
+
+typedef struct {
+    // Stored last, with release semantics, by seg7mailbox_create().
+    _Atomic uint32_t magic;
+    uint32_t display_count;
+    uint32_t digits;
+    _Atomic uint32_t polls;
+    Seg7Slot slots[SEG7MAILBOX_MAX_DISPLAYS];
+    Seg7Stats stats[SEG7MAILBOX_MAX_DISPLAYS];
+} Seg7Mailbox;
+
+// Creates (or recreates) the mailbox. Used by the daemon. Returns NULL on error.
+Seg7Mailbox* seg7mailbox_create(uint8_t display_count, uint8_t digits);
+// Opens an existing mailbox. Used by producers. Returns NULL on error.
+Seg7Mailbox* seg7mailbox_open();
+void seg7mailbox_close(Seg7Mailbox *mailbox);
+// Unlinks the shared memory object. Used by the daemon when it quits.
+void seg7mailbox_destroy(Seg7Mailbox *mailbox);
+
+static inline void seg7mailbox_post(
+    Seg7Mailbox *mailbox, uint8_t display, uint32_t value, uint8_t dotmask)
+{
+    atomic_store_explicit(
+        &mailbox->slots[display].word,
+        SEG7SLOT_POSTED | ((uint64_t)dotmask << 32) | value,
+        memory_order_release);
+}
+
+static inline uint64_t seg7mailbox_peek(Seg7Mailbox *mailbox, uint8_t display)
+{
+    return atomic_load_explicit(&mailbox->slots[display].word, memory_order_acquire);
+}
+
+static inline uint32_t seg7slot_value(uint64_t word)
+{
+    return (uint32_t)word;
+}
+
+static inline uint8_t seg7slot_dotmask(uint64_t word)
+{
+    return (uint8_t)(word >> 32);
+}
@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "seg7mailbox.h"
+
+/* Minimal seg7d producer
+ *
+ * Usage:
+ *   seg7post <display> <value> [dotmask]    post a value to a display
+ *   seg7post -s                             print per-display stats
+ */
+
+static void print_stats(Seg7Mailbox *mailbox)
+{
+    uint32_t i;
+    Seg7Stats *stats;
+
+    printf("polls: %u\n", atomic_load(&mailbox->polls));
+    for (i = 0; i < mailbox->display_count; i++) {
+        stats = &mailbox->stats[i];
+        printf(
+            "display %u: sent %u frames, last %u (dots 0x%x), batch took %uus (max %uus)\n",
+            i,
+            atomic_load(&stats->frames_sent),
+            atomic_load(&stats->last_value),
+            atomic_load(&stats->last_dotmask),
+            atomic_load(&stats->last_batch_usecs),
+            atomic_load(&stats->max_batch_usecs));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t display;
+    Seg7Mailbox *mailbox;
+
+    if ((argc < 2) || ((strcmp(argv[1], "-s") != 0) && (argc < 3))) {
+        fprintf(stderr, "usage: seg7post <display> <value> [dotmask] | seg7post -s\n");
+        return 1;
+    }
+    mailbox = seg7mailbox_open();
+    if (mailbox == NULL) {
+        return 1;
+    }
+    if (strcmp(argv[1], "-s") == 0) {
+        print_stats(mailbox);
+    } else {
+        display = strtoul(argv[1], NULL, 0);
+        if (display >= mailbox->display_count) {
+            fprintf(stderr, "seg7d only drives %u displays\n", mailbox->display_count);
+            seg7mailbox_close(mailbox);
+            return 1;
+        }
+        seg7mailbox_post(
+            mailbox, display, strtoul(argv[2], NULL, 0),
+            argc > 3 ? strtoul(argv[3], NULL, 0) : 0);
+    }
+    seg7mailbox_close(mailbox);
+    return 0;
+}
@@ -0,0 +1,27 @@
+#include <unistd.h>
+
+#include "seg7encoder.h"
+#include "seg7send.h"
+
+int seg7send_paced(
+    struct ftdi_context *ftdi, const uint8_t *samples, size_t count, uint8_t digits)
+{
+    size_t i;
+    size_t pos;
+    int ret;
+
+    for (i = 0; i < count; i++) {
+        ret = ftdi_write_data(ftdi, (unsigned char *)&samples[i], 1);
+        if (ret < 0) {
+            return ret;
+        }
+        usleep(SEG7SEND_SLEEPDELAY);
+        // Position in the frame, after the announce bit.
+        pos = i % SEG7ENC_FRAME_SAMPLES(digits);
+        if ((pos >= SEG7ENC_SAMPLES_PER_BIT) &&
+            ((pos - SEG7ENC_SAMPLES_PER_BIT + 1) % SEG7ENC_SYMBOL_SAMPLES == 0)) {
+            usleep(SEG7SEND_SLEEPDELAY);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <ftdi.h>
+
+/* Paced sending of encoded samples
+ *
+ * Sends samples from seg7encoder.h to the FTDI device one at a time, sleeping
+ * SEG7SEND_SLEEPDELAY after each of them and once more after each symbol. This
+ * is the pacing ftdiclient always had and that is known to work with the
+ * boards. Letting the chip clock samples out on its own, at a rate derived
+ * from the baudrate, would be much faster, but it needs to be validated on
+ * real hardware first.
+ */
+
+#define SEG7SEND_SLEEPDELAY 20
+
+// Sends `count` samples made of frames of `digits` digits. Returns 0 on
+// success and the (negative) result of ftdi_write_data() on error.
+int seg7send_paced(
+    struct ftdi_context *ftdi, const uint8_t *samples, size_t count, uint8_t digits);
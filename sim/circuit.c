@@ -6,15 +6,22 @@ void seg7multiplex_circuit_init(Seg7Multiplex *circuit, ICePin *ser, ICePin *clk
 {
     int i;
     ShiftRegister *sr_lu;
+    ICeChip *glyph_sr;
 
     icemu_ATtiny_init(&circuit->mcu);
-    icemu_mcu_set_runloop(&circuit->mcu, seg7multiplex_loop, 20);
+    icemu_mcu_set_runloop(&circuit->mcu, seg7multiplex_loop, RUNLOOP_USECS);
     circuit->PB0 = circuit->mcu.pins.pins[0];
     circuit->PB1 = circuit->mcu.pins.pins[1];
     circuit->PB2 = circuit->mcu.pins.pins[2];
     circuit->PB3 = circuit->mcu.pins.pins[3];
     circuit->PB4 = circuit->mcu.pins.pins[4];
     icemu_SN74HC595_init(&circuit->sr);
+#if DIGITS > 4
+    icemu_SN74HC595_init(&circuit->sr2);
+    glyph_sr = &circuit->sr2;
+#else
+    glyph_sr = &circuit->sr;
+#endif
     icemu_SN7447A_init(&circuit->dec);
     sr_lu = (ShiftRegister *)circuit->sr.logical_unit;
     for (i = 0; i < DIGITS; i++) {
@@ -27,11 +34,18 @@ void seg7multiplex_circuit_init(Seg7Multiplex *circuit, ICePin *ser, ICePin *clk
     icemu_pin_wireto(circuit->PB4, icemu_chip_getpin(&circuit->sr, "SER"));
     icemu_pin_wireto(circuit->PB0, icemu_chip_getpin(&circuit->sr, "RCLK"));
     icemu_pin_wireto(circuit->PB0, icemu_chip_getpin(&circuit->sr, "OE"));
+#if DIGITS > 4
+    icemu_pin_wireto(circuit->PB3, icemu_chip_getpin(&circuit->sr2, "SRCLK"));
+    icemu_pin_wireto(
+        icemu_chip_getpin(&circuit->sr, "QH'"), icemu_chip_getpin(&circuit->sr2, "SER"));
+    icemu_pin_wireto(circuit->PB0, icemu_chip_getpin(&circuit->sr2, "RCLK"));
+    icemu_pin_wireto(circuit->PB0, icemu_chip_getpin(&circuit->sr2, "OE"));
+#endif
 
-    icemu_pin_wireto(icemu_chip_getpin(&circuit->sr, "QE"), icemu_chip_getpin(&circuit->dec, "A"));
-    icemu_pin_wireto(icemu_chip_getpin(&circuit->sr, "QF"), icemu_chip_getpin(&circuit->dec, "B"));
-    icemu_pin_wireto(icemu_chip_getpin(&circuit->sr, "QG"), icemu_chip_getpin(&circuit->dec, "C"));
-    icemu_pin_wireto(icemu_chip_getpin(&circuit->sr, "QH"), icemu_chip_getpin(&circuit->dec, "D"));
+    icemu_pin_wireto(icemu_chip_getpin(glyph_sr, "QE"), icemu_chip_getpin(&circuit->dec, "A"));
+    icemu_pin_wireto(icemu_chip_getpin(glyph_sr, "QF"), icemu_chip_getpin(&circuit->dec, "B"));
+    icemu_pin_wireto(icemu_chip_getpin(glyph_sr, "QG"), icemu_chip_getpin(&circuit->dec, "C"));
+    icemu_pin_wireto(icemu_chip_getpin(glyph_sr, "QH"), icemu_chip_getpin(&circuit->dec, "D"));
 
     for (i = 0; i < DIGITS; i++) {
         icemu_displaydecoder_wireto_seg7(&circuit->dec, &circuit->segs[i]);
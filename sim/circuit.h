@@ -1,11 +1,19 @@
 #pragma once
 #include "icemu.h"
 
+#ifndef DIGITS
 #define DIGITS 4
+#endif
+// Interval, in usecs, at which the MCU runloop is called.
+#define RUNLOOP_USECS 20
 
 typedef struct {
     ICeChip mcu;
     ICeChip sr;
+#if DIGITS > 4
+    // Daisy-chained after sr, holds the glyph in its high 4 bits.
+    ICeChip sr2;
+#endif
     ICeChip dec;
     ICeChip segs[DIGITS];
     ICePin *PB0;
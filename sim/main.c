@@ -1,11 +1,11 @@
 #include <stdio.h>
 #include <unistd.h>
-#include <assert.h>
 #include "../common/pin.h"
 #include "../common/timer.h"
-#include "../common/intmath.h"
+#include "../bench/seg7encoder.h"
 #include "icemu.h"
 #include "circuit.h"
+#include "perceived.h"
 
 void seg7multiplex_int0_interrupt();
 void seg7multiplex_timer0_interrupt();
@@ -16,8 +16,10 @@ static Seg7Multiplex circuit;
 static ICePin ser;
 static ICePin clk;
 static ICeChip ftdi;
+static Seg7Encoder encoder;
 unsigned int display_val = 1234;
 unsigned int display_dotmask = 0;
+static unsigned long elapsed_usecs = 0;
 
 /* Utils */
 static ICePin* getpin(PinID pinid)
@@ -32,44 +34,35 @@ static ICePin* getpin(PinID pinid)
     }
 }
 
-static void push_serial(bool high)
+static void push_sample(uint8_t sample)
 {
-    icemu_pin_set(&clk, false);
-    icemu_pin_set(&ser, high);
+    // CLK goes first so that it's low before SER changes.
+    icemu_pin_set(&clk, sample & 0x2);
+    icemu_pin_set(&ser, sample & 0x1);
     /* These 20us delays are necessary when running in FTDI mode with the prototype connected
      * to our two serial pins. Without those delays, CLK toggles too fast for the MCU. 20us seems
      * rather high to me, I'm not so sure why it's so high, but then again, it's the threshold that
      * works without sending corrupt digits. 40us per bit means 200us per digit. Fair enough.
      */
     icemu_sim_delay(20);
-    icemu_pin_set(&clk, true);
-    icemu_sim_delay(20);
-}
-
-static void push_digit(uint8_t digit, bool enable_dot)
-{
-    assert(digit < 10);
-
-    push_serial(digit & 1);
-    push_serial(digit & (1 << 1));
-    push_serial(digit & (1 << 2));
-    push_serial(digit & (1 << 3));
-    push_serial(enable_dot);
 }
 
 static void push_number(uint32_t val, uint8_t display_dotmask)
 {
-    int i;
-    bool hasdot;
-
-    // we start with an empty CLK to begin;
-    push_serial(false);
-
-    for (i = 0; i < DIGITS; i++) {
-        hasdot = display_dotmask & (1 << i);
-        push_digit((val / int_pow10(i)) % 10, hasdot);
-        // let the runloop breathe a little
-        seg7multiplex_loop();
+    uint8_t samples[SEG7ENC_FRAME_SAMPLES(DIGITS)];
+    Seg7Frame frame = {0, val, display_dotmask};
+    size_t count;
+    size_t i;
+
+    perceived_request(val, display_dotmask);
+    count = seg7enc_frame(&encoder, samples, &frame);
+    for (i = 0; i < count; i++) {
+        push_sample(samples[i]);
+        if ((i >= SEG7ENC_SAMPLES_PER_BIT) &&
+                ((i - SEG7ENC_SAMPLES_PER_BIT) % SEG7ENC_SYMBOL_SAMPLES == SEG7ENC_SYMBOL_SAMPLES - 1)) {
+            // let the runloop breathe a little after each digit
+            seg7multiplex_loop();
+        }
     }
 }
 
@@ -109,6 +102,14 @@ void set_timer0_mode(TIMER_MODE mode)
 {
 }
 
+/* Runloop wrapper that feeds the perceived value timeline */
+static void sampled_loop()
+{
+    seg7multiplex_loop();
+    elapsed_usecs += RUNLOOP_USECS;
+    perceived_sample(elapsed_usecs);
+}
+
 /* Main */
 void increase_value()
 {
@@ -128,15 +129,31 @@ void cycle_dotmask()
     push_number(display_val, display_dotmask);
 }
 
-int main()
+/* Usage: seg7multiplex [timeline_path]
+ *
+ * When a path is given, the perceived value timeline (see perceived.h) is
+ * written to it.
+ */
+int main(int argc, char *argv[])
 {
     int i;
     bool has_ftdi;
+    FILE *timeline;
 
     icemu_pin_init(&ser, NULL, "SER", true);
     icemu_pin_init(&clk, NULL, "CLK", true);
 
     seg7multiplex_circuit_init(&circuit, &ser, &clk);
+    seg7enc_init(&encoder, DIGITS);
+    if (argc > 1) {
+        timeline = fopen(argv[1], "w");
+        if (timeline == NULL) {
+            perror(argv[1]);
+            return 1;
+        }
+        perceived_init(&circuit, timeline);
+        icemu_mcu_set_runloop(&circuit.mcu, sampled_loop, RUNLOOP_USECS);
+    }
 
     has_ftdi = icemu_FT232H_init(&ftdi);
     if (has_ftdi) {
@@ -153,6 +170,9 @@ int main()
     icemu_sim_add_action('d', "Cycle (d)otmask", cycle_dotmask);
     icemu_ui_add_element("MCU", &circuit.mcu);
     icemu_ui_add_element("SR", &circuit.sr);
+#if DIGITS > 4
+    icemu_ui_add_element("SR2", &circuit.sr2);
+#endif
     icemu_ui_add_element("DEC", &circuit.dec);
     if (has_ftdi) {
         icemu_ui_add_element("FTDI", &ftdi);
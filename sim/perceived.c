@@ -0,0 +1,324 @@
+#include <stdbool.h>
+#include <string.h>
+#include "perceived.h"
+
+#define DP_SEGMENT 7
+
+// What a human reads on the displays. First element is the leftmost digit.
+typedef struct {
+    char glyphs[DIGITS];
+    bool dots[DIGITS];
+} Reading;
+
+// Segments, from bit 0 to 6: A, B, C, D, E, F, G. Index is the digit.
+// The SN7447A has its own take on 6 and 9 (no tail), so we accept both forms.
+static const uint8_t glyph_masks[10] = {
+    0x3f, 0x06, 0x5b, 0x4f, 0x66, 0x6d, 0x7c, 0x07, 0x7f, 0x67
+};
+static const uint8_t alt_glyph_masks[10] = {
+    0x3f, 0x06, 0x5b, 0x4f, 0x66, 0x6d, 0x7d, 0x07, 0x7f, 0x6f
+};
+static char *segment_names[8] = {"A", "B", "C", "D", "E", "F", "G", "DP"};
+
+// Lit segments of each digit at a given time.
+typedef struct {
+    unsigned long usecs;
+    uint8_t lit[DIGITS];
+} Sample;
+
+// Samples come every RUNLOOP_USECS, but we don't count on it: we keep samples
+// by time and only use the capacity as a safety net.
+#define MAX_SAMPLES (PERCEIVED_WINDOW_USECS / RUNLOOP_USECS + 1)
+
+static FILE *timeline;
+static ICePin *commons[DIGITS];
+static ICePin *segments[DIGITS][8];
+// Samples of the last PERCEIVED_WINDOW_USECS, oldest first, in a ring.
+static Sample samples[MAX_SAMPLES];
+static unsigned int first_sample;
+static unsigned int sample_count;
+// Number of samples, in the window, during which each segment was lit.
+static unsigned int lit_counts[DIGITS][8];
+// Start of the current GAP window. GAP is reported per fixed window.
+static unsigned long window_start;
+static unsigned long last_usecs;
+static unsigned long request_usecs;
+// Last time each digit had a lit segment. 0 means never.
+static unsigned long last_lit[DIGITS];
+static unsigned long window_gap;
+static unsigned long previous_gap;
+static Reading stable;
+// What the window read at the previous sample
+static Reading current;
+static Reading target;
+static bool has_target;
+
+static void render(const Reading *reading, char *dest)
+{
+    int i;
+
+    for (i = 0; i < DIGITS; i++) {
+        *dest++ = reading->glyphs[i];
+        if (reading->dots[i]) {
+            *dest++ = '.';
+        }
+    }
+    *dest = '\0';
+}
+
+static char decode_glyph(uint8_t mask)
+{
+    int i;
+
+    if (mask == 0) {
+        return ' ';
+    }
+    for (i = 0; i < 10; i++) {
+        if ((mask == glyph_masks[i]) || (mask == alt_glyph_masks[i])) {
+            return '0' + i;
+        }
+    }
+    return '?';
+}
+
+// Segments, DP included, that can be lit for a digit showing `glyph`.
+static uint8_t reading_mask(const Reading *reading, int i)
+{
+    uint8_t res = 0;
+    char glyph = reading->glyphs[i];
+
+    if ((glyph >= '0') && (glyph <= '9')) {
+        res = glyph_masks[glyph - '0'] | alt_glyph_masks[glyph - '0'];
+    }
+    if (reading->dots[i]) {
+        res |= 1 << DP_SEGMENT;
+    }
+    return res;
+}
+
+// A segment is perceived as lit if it was lit for at least half as long as
+// the brightest segment of its digit. This filters out short glitches, such
+// as DP following SER while the shift register is being fed. The perceived
+// segments of each digit go in `masks`.
+static void decode_window(Reading *reading, uint8_t *masks)
+{
+    int i, j;
+    unsigned int brightest;
+    uint8_t mask;
+
+    for (i = 0; i < DIGITS; i++) {
+        brightest = 0;
+        for (j = 0; j < 8; j++) {
+            if (lit_counts[i][j] > brightest) {
+                brightest = lit_counts[i][j];
+            }
+        }
+        mask = 0;
+        for (j = 0; j < 8; j++) {
+            if ((lit_counts[i][j] > 0) && (lit_counts[i][j] * 2 >= brightest)) {
+                mask |= 1 << j;
+            }
+        }
+        reading->glyphs[i] = decode_glyph(mask & ~(1 << DP_SEGMENT));
+        reading->dots[i] = mask & (1 << DP_SEGMENT);
+        masks[i] = mask;
+    }
+}
+
+static bool is_garbled(const Reading *reading)
+{
+    return memchr(reading->glyphs, '?', DIGITS) != NULL;
+}
+
+// A torn window is one that isn't what we're waiting for, but where every
+// digit only has segments of what was there before and of what we're waiting
+// for. We judge segments, not glyphs: a blend of two glyphs can very well
+// decode as a third one, such as 2 and 6 reading as 8.
+static bool is_mixed(const Reading *reading, const uint8_t *masks)
+{
+    int i;
+
+    if (!has_target) {
+        return false;
+    }
+    if (memcmp(reading, &target, sizeof(Reading)) == 0) {
+        return false;
+    }
+    for (i = 0; i < DIGITS; i++) {
+        if (masks[i] & ~(reading_mask(&stable, i) | reading_mask(&target, i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void end_gap_window()
+{
+    if (window_gap != previous_gap) {
+        fprintf(timeline, "%lu GAP %lu\n", window_start, window_gap);
+        fflush(timeline);
+        previous_gap = window_gap;
+    }
+    window_gap = 0;
+}
+
+static void drop_oldest_sample()
+{
+    int i, j;
+    Sample *sample = &samples[first_sample];
+
+    for (i = 0; i < DIGITS; i++) {
+        for (j = 0; j < 8; j++) {
+            if (sample->lit[i] & (1 << j)) {
+                lit_counts[i][j]--;
+            }
+        }
+    }
+    first_sample = (first_sample + 1) % MAX_SAMPLES;
+    sample_count--;
+}
+
+static void add_sample(const Sample *sample)
+{
+    int i, j;
+
+    while ((sample_count > 0) &&
+           ((sample_count == MAX_SAMPLES) ||
+            (sample->usecs - samples[first_sample].usecs >= PERCEIVED_WINDOW_USECS))) {
+        drop_oldest_sample();
+    }
+    samples[(first_sample + sample_count) % MAX_SAMPLES] = *sample;
+    sample_count++;
+    for (i = 0; i < DIGITS; i++) {
+        for (j = 0; j < 8; j++) {
+            if (sample->lit[i] & (1 << j)) {
+                lit_counts[i][j]++;
+            }
+        }
+    }
+}
+
+// Judges what the window ending at `usecs` reads. Lines are only written when
+// that changes, so a reading is reported at the first sample where it can be
+// read.
+static void judge_window(unsigned long usecs)
+{
+    Reading reading;
+    uint8_t masks[DIGITS];
+    char s[DIGITS * 2 + 1];
+
+    if (usecs < PERCEIVED_WINDOW_USECS) {
+        // The first window isn't full yet, digits would appear one by one.
+        return;
+    }
+    decode_window(&reading, masks);
+    if (memcmp(&reading, &current, sizeof(Reading)) == 0) {
+        return;
+    }
+    current = reading;
+    if (memcmp(&reading, &stable, sizeof(Reading)) == 0) {
+        return;
+    }
+    render(&reading, s);
+    if (is_mixed(&reading, masks)) {
+        fprintf(timeline, "%lu MIXED %s\n", usecs, s);
+        fflush(timeline);
+        return;
+    }
+    if (is_garbled(&reading)) {
+        // Nobody can read that, so it never becomes our stable reading.
+        fprintf(timeline, "%lu GARBLED %s\n", usecs, s);
+        fflush(timeline);
+        return;
+    }
+    stable = reading;
+    if (has_target && (memcmp(&reading, &target, sizeof(Reading)) == 0)) {
+        fprintf(timeline, "%lu STABLE %s %lu\n", usecs, s, usecs - request_usecs);
+        has_target = false;
+    } else {
+        fprintf(timeline, "%lu STABLE %s\n", usecs, s);
+    }
+    fflush(timeline);
+}
+
+void perceived_init(Seg7Multiplex *circuit, FILE *out)
+{
+    int i, j;
+
+    timeline = out;
+    for (i = 0; i < DIGITS; i++) {
+        commons[i] = icemu_ledmatrix_common_pin(&circuit->segs[i]);
+        for (j = 0; j < 8; j++) {
+            segments[i][j] = icemu_chip_getpin(&circuit->segs[i], segment_names[j]);
+        }
+    }
+    memset(lit_counts, 0, sizeof(lit_counts));
+    first_sample = 0;
+    sample_count = 0;
+    memset(&stable, ' ', sizeof(stable.glyphs));
+    memset(stable.dots, 0, sizeof(stable.dots));
+    current = stable;
+    memset(last_lit, 0, sizeof(last_lit));
+    has_target = false;
+    window_start = 0;
+    window_gap = 0;
+    previous_gap = 0;
+    last_usecs = 0;
+}
+
+void perceived_request(uint32_t val, uint8_t dotmask)
+{
+    int i;
+    char s[DIGITS * 2 + 1];
+
+    if (timeline == NULL) {
+        return;
+    }
+    // Leftmost display is the most significant digit, but dotmask bits are
+    // mapped to the displays in the order of the shift register outputs.
+    for (i = DIGITS - 1; i >= 0; i--) {
+        target.glyphs[i] = '0' + (val % 10);
+        target.dots[i] = dotmask & (1 << i);
+        val /= 10;
+    }
+    has_target = true;
+    request_usecs = last_usecs;
+    render(&target, s);
+    fprintf(timeline, "%lu REQ %s\n", request_usecs, s);
+}
+
+void perceived_sample(unsigned long elapsed_usecs)
+{
+    int i, j;
+    Sample sample;
+
+    if (timeline == NULL) {
+        return;
+    }
+    last_usecs = elapsed_usecs;
+    if (elapsed_usecs - window_start >= PERCEIVED_WINDOW_USECS) {
+        end_gap_window();
+        window_start = elapsed_usecs;
+    }
+    sample.usecs = elapsed_usecs;
+    // Displays are common anode and segments are driven low by the decoder.
+    for (i = 0; i < DIGITS; i++) {
+        sample.lit[i] = 0;
+        if (!commons[i]->high) {
+            continue;
+        }
+        for (j = 0; j < 8; j++) {
+            if (!segments[i][j]->high) {
+                sample.lit[i] |= 1 << j;
+            }
+        }
+        if (sample.lit[i]) {
+            if ((last_lit[i] > 0) && (elapsed_usecs - last_lit[i] > window_gap)) {
+                window_gap = elapsed_usecs - last_lit[i];
+            }
+            last_lit[i] = elapsed_usecs;
+        }
+    }
+    add_sample(&sample);
+    judge_window(elapsed_usecs);
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include "circuit.h"
+
+// Window over which lit segments blend together for the eye. That's the same
+// 10ms threshold we use for flickering. Readings are judged over the window
+// that ends at each sample, GAP is reported per consecutive windows.
+#define PERCEIVED_WINDOW_USECS 10000
+
+/* "Perceived value" timeline
+ *
+ * Decodes the segments of the simulated displays back into what a human would
+ * read and writes a timeline of it to `out`. Lines look like this:
+ *
+ *   <usecs> REQ <reading>                 push_number() was called
+ *   <usecs> STABLE <reading> [<latency>]  reading became stable at <usecs>
+ *   <usecs> MIXED <reading>               window showed old and new segments
+ *   <usecs> GARBLED <reading>             window had unreadable digits, but
+ *                                         not from old and new segments
+ *   <usecs> GAP <usecs>                   longest a digit stayed dark in the
+ *                                         window, when it differs from the
+ *                                         previous window
+ *
+ * In readings, '?' is a digit for which the lit segments don't form a glyph
+ * (typically the union of an old and a new glyph) and ' ' is a dark digit.
+ * Latency is given when the stable reading is the one last requested: it's
+ * the time between the request and the first sample where the window ending
+ * there reads as the requested value. It includes the transfer, the wait for
+ * refresh rounds and the time it takes for old segments to fade out of the
+ * window. Its precision is that of the sampling interval.
+ *
+ * Readings are only written when they change, and nothing is written before
+ * the first window is full.
+ *
+ * GAP is what tells us the effective refresh rate of each digit. Its
+ * precision is bound by the sampling interval, RUNLOOP_USECS.
+ */
+void perceived_init(Seg7Multiplex *circuit, FILE *out);
+// Call with what we're about to send to the board.
+void perceived_request(uint32_t val, uint8_t dotmask);
+// Call regularly (each runloop) with the elapsed simulation time.
+void perceived_sample(unsigned long elapsed_usecs);
@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../common/pin.h"
+#include "../common/timer.h"
+
+void seg7multiplex_int0_interrupt();
+void seg7multiplex_timer0_interrupt();
+void seg7multiplex_setup();
+void seg7multiplex_loop();
+
+#ifndef DIGITS
+#define DIGITS 4
+#endif
+#if DIGITS > 4
+#define SR_BITS 16
+#else
+#define SR_BITS 8
+#endif
+#define GLYPH_SHIFT (SR_BITS - 4)
+#define BLANK_GLYPH 15
+
+/* Headless timing harness
+ *
+ * Runs the firmware against a model of the circuit (shift registers, decoder,
+ * displays) without icemu, and reports refresh timing, DP ghosting and the
+ * cost of each loop iteration.
+ *
+ * By default, time is counted in MCU cycles, which are usecs at F_CPU=1MHz.
+ * Each bit sent to the shift registers and each bit of work done by the loop
+ * advances the clock by an estimated number of cycles (see below) and
+ * interrupts are delivered as the clock advances, so they can happen in the
+ * middle of a loop iteration, like on the real thing. These costs are
+ * estimates for the MCU build, where shift register pins are written straight
+ * to PORTB, not counts from the compiled firmware.
+ *
+ * With -r, each loop iteration takes RUNLOOP_USECS regardless of what it does
+ * and interrupts are delivered between iterations, like in the icemu
+ * simulation.
+ *
+ * Usage: ./timing [-r]
+ */
+
+#define RUNLOOP_USECS 20
+// Estimated costs, in cycles. They're counted by hand from the C code, with
+// what avr-gcc usually emits for it, and haven't been checked against the
+// compiled firmware. Variable shifts (1 << index) compile to loops on AVR,
+// which is why the serial queue costs more than it looks.
+#define LOOP_CYCLES 30 // call, input_mode check, refresh check
+#define SHIFT_CYCLES 20 // a bit sent to the shift registers, see ROUND_COST_USECS
+#define LATCH_CYCLES 40 // SER_DP and the RCLK pulse, after the last bit
+// INT0: it calls pinishigh() in another unit, so the prologue saves all
+// call-clobbered registers (~35 cycles each way), plus the call (~15) and
+// serial_queue_write() on volatile data with a variable shift (~30).
+#define ISR_CYCLES 110
+// serial_queue_read() (variable shift, volatile loads and stores) and
+// ser_input |= 1 << ser_input_pos (another variable shift).
+#define BIT_CYCLES 50
+#define DIGIT_CYCLES 20 // push_digit() and add_digit_round()
+#define RESET_ROUNDS_CYCLES 60 // begin_input_mode() and its 10-steps loop
+#define COMPLETE_ROUNDS_CYCLES 40 // end_input_mode() without missing digits
+#define SELECT_CYCLES 40 // select_next_round()
+
+typedef struct {
+    unsigned long t;
+    bool ser;
+    bool clk;
+} Edge;
+
+#define MAX_EDGES ((1 + DIGITS * 5) * 2)
+
+static bool fixed_runloop;
+static bool pins[5];
+static uint32_t chain;
+static uint32_t latched;
+static unsigned long slot_usecs;
+static unsigned long now;
+static unsigned long next_tick;
+
+static Edge edges[MAX_EDGES];
+static int edge_count;
+static int edge_index;
+// Input state of the current frame
+static bool announced;
+static bool began;
+static int bits_written;
+static int bits_drained;
+
+// Per iteration
+static int pin_ops;
+static int latches;
+static unsigned long isr_cycles;
+
+// Display observation
+static unsigned long last_observation;
+static bool digit_lit[DIGITS];
+static unsigned long dark_since[DIGITS];
+static unsigned long longest_gap;
+static unsigned long ghost_usecs;
+static unsigned long non_dp_usecs;
+static unsigned long last_latch;
+static unsigned long shortest_round;
+static unsigned long longest_round;
+static int seen_glyphs[DIGITS];
+static bool seen_dots[DIGITS];
+
+static unsigned int latched_glyph()
+{
+    return (latched >> GLYPH_SHIFT) & 0xf;
+}
+
+static bool is_lit(int i)
+{
+    // OE is active low and wired to RCLK. DP round lights nothing if DP is off.
+    if (pins[PinB0] || !(latched & (1 << i))) {
+        return false;
+    }
+    return (latched_glyph() != BLANK_GLYPH) || !pins[PinB4];
+}
+
+static void observe()
+{
+    int i;
+    unsigned long dt = now - last_observation;
+    bool lit;
+    bool any_lit = false;
+
+    for (i = 0; i < DIGITS; i++) {
+        any_lit |= digit_lit[i];
+    }
+    if (latched_glyph() != BLANK_GLYPH) {
+        non_dp_usecs += dt;
+        if (any_lit && !pins[PinB4]) {
+            ghost_usecs += dt;
+        }
+    }
+    last_observation = now;
+    for (i = 0; i < DIGITS; i++) {
+        lit = is_lit(i);
+        if (lit && !digit_lit[i]) {
+            if (now - dark_since[i] > longest_gap) {
+                longest_gap = now - dark_since[i];
+            }
+        } else if (!lit && digit_lit[i]) {
+            dark_since[i] = now;
+        }
+        digit_lit[i] = lit;
+        if (lit) {
+            if (latched_glyph() == BLANK_GLYPH) {
+                seen_dots[i] = true;
+            } else {
+                seen_glyphs[i] = latched_glyph();
+            }
+        }
+    }
+}
+
+static void deliver()
+{
+    Edge *e;
+
+    while (1) {
+        if ((edge_index < edge_count) && (edges[edge_index].t <= now)) {
+            e = &edges[edge_index++];
+            pins[PinB1] = e->ser;
+            if (e->clk && !pins[PinB2]) {
+                pins[PinB2] = true;
+                seg7multiplex_int0_interrupt();
+                if (announced) {
+                    bits_written++;
+                }
+                announced = true;
+                if (!fixed_runloop) {
+                    now += ISR_CYCLES;
+                    isr_cycles += ISR_CYCLES;
+                }
+            }
+            pins[PinB2] = e->clk;
+        } else if (slot_usecs && (next_tick <= now)) {
+            next_tick += slot_usecs;
+            seg7multiplex_timer0_interrupt();
+        } else {
+            return;
+        }
+    }
+}
+
+static void advance(unsigned long cycles)
+{
+    now += cycles;
+    observe();
+    deliver();
+}
+
+/* Layer impl */
+void pinset(PinID pinid, bool high)
+{
+    unsigned long cost = 0;
+
+    if ((pinid == PinB3) && high && !pins[pinid]) {
+        chain = (chain << 1) | pins[PinB4];
+    }
+    if ((pinid == PinB0) && high && !pins[pinid]) {
+        latched = chain;
+        latches++;
+    }
+    // Other pin operations are part of these costs.
+    if ((pinid == PinB3) && high && !pins[pinid]) {
+        cost = SHIFT_CYCLES;
+    } else if ((pinid == PinB0) && !high && pins[pinid]) {
+        cost = LATCH_CYCLES;
+    }
+    pins[pinid] = high;
+    pin_ops++;
+    if (!fixed_runloop) {
+        advance(cost);
+    } else {
+        observe();
+    }
+}
+
+void pinlow(PinID pinid)
+{
+    pinset(pinid, false);
+}
+
+void pinhigh(PinID pinid)
+{
+    pinset(pinid, true);
+}
+
+bool pinishigh(PinID pinid)
+{
+    return pins[pinid];
+}
+
+void pinoutputmode(PinID pinid)
+{
+}
+
+bool set_timer0_target(unsigned long usecs)
+{
+    slot_usecs = usecs;
+    return true;
+}
+
+void set_timer0_mode(TIMER_MODE mode)
+{
+}
+
+/* Harness */
+typedef struct {
+    unsigned long display_cycles;
+    int display_pin_ops;
+    unsigned long input_cycles;
+    int input_bits;
+} Worst;
+
+static Worst worst;
+
+static void track_rounds()
+{
+    if (!latches) {
+        return;
+    }
+    if (last_latch && (now - last_latch < shortest_round)) {
+        shortest_round = now - last_latch;
+    }
+    if (last_latch && (now - last_latch > longest_round)) {
+        longest_round = now - last_latch;
+    }
+    last_latch = now;
+}
+
+static void iterate()
+{
+    unsigned long start = now;
+    unsigned long cost;
+    int pending;
+    bool input;
+
+    pin_ops = 0;
+    latches = 0;
+    isr_cycles = 0;
+    input = announced && (bits_drained < DIGITS * 5);
+    pending = bits_written - bits_drained;
+    seg7multiplex_loop();
+    bits_drained += pending;
+    if (fixed_runloop) {
+        advance(RUNLOOP_USECS);
+        track_rounds();
+        return;
+    }
+    cost = LOOP_CYCLES + latches * SELECT_CYCLES + pending * BIT_CYCLES;
+    cost += (bits_drained / 5 - (bits_drained - pending) / 5) * DIGIT_CYCLES;
+    if (input && !began) {
+        began = true;
+        cost += RESET_ROUNDS_CYCLES;
+    }
+    if (pending && (bits_drained == DIGITS * 5)) {
+        cost += COMPLETE_ROUNDS_CYCLES;
+    }
+    advance(cost);
+    track_rounds();
+    // Interrupts that landed during the iteration aren't the loop's work.
+    cost = now - start - isr_cycles;
+    if (input) {
+        if (cost > worst.input_cycles) {
+            worst.input_cycles = cost;
+            worst.input_bits = pending;
+        }
+    } else if (cost > worst.display_cycles) {
+        worst.display_cycles = cost;
+        worst.display_pin_ops = pin_ops;
+    }
+}
+
+static void run_for(unsigned long usecs)
+{
+    unsigned long until = now + usecs;
+
+    while (now < until) {
+        iterate();
+    }
+}
+
+static void reset_stats()
+{
+    longest_gap = 0;
+    ghost_usecs = 0;
+    non_dp_usecs = 0;
+    last_latch = 0;
+    shortest_round = (unsigned long)-1;
+    longest_round = 0;
+}
+
+static void schedule_frame(uint32_t val, uint8_t dotmask, unsigned long bit_usecs)
+{
+    int i, b;
+    int symbol;
+    unsigned long t = now;
+
+    edge_count = 0;
+    edge_index = 0;
+    announced = false;
+    began = false;
+    bits_written = 0;
+    bits_drained = 0;
+    edges[edge_count++] = (Edge){t, false, false};
+    edges[edge_count++] = (Edge){t + bit_usecs / 2, false, true};
+    for (i = 0; i < DIGITS; i++) {
+        symbol = (val % 10) | ((dotmask & (1 << i)) ? 0x10 : 0);
+        val /= 10;
+        for (b = 0; b < 5; b++) {
+            t += bit_usecs;
+            edges[edge_count++] = (Edge){t, symbol & (1 << b), false};
+            edges[edge_count++] = (Edge){t + bit_usecs / 2, symbol & (1 << b), true};
+        }
+    }
+}
+
+// Sends a frame, lets the display run and checks what the displays show.
+static bool check_frame(uint32_t val, uint8_t dotmask, unsigned long bit_usecs)
+{
+    int i;
+    bool res = true;
+
+    schedule_frame(val, dotmask, bit_usecs);
+    run_for((1 + DIGITS * 5) * bit_usecs + 20000);
+    memset(seen_glyphs, -1, sizeof(seen_glyphs));
+    memset(seen_dots, 0, sizeof(seen_dots));
+    run_for(20000);
+    for (i = DIGITS - 1; i >= 0; i--) {
+        res &= seen_glyphs[i] == (int)(val % 10);
+        val /= 10;
+        res &= seen_dots[i] == ((dotmask & (1 << i)) != 0);
+    }
+    return res;
+}
+
+static void boot()
+{
+    memset(pins, 0, sizeof(pins));
+    pins[PinB2] = true;
+    edge_count = 0;
+    edge_index = 0;
+    announced = false;
+    seg7multiplex_setup();
+    next_tick = now + slot_usecs;
+}
+
+int main(int argc, char *argv[])
+{
+    static const uint32_t values[] = {1234, 98765432, 11111111, 50505050, 73};
+    static const uint8_t dotmasks[] = {0, 0x2, 0, 0x81, 0x1};
+    unsigned long bit_usecs;
+    unsigned long shortest_bit = 0;
+    Worst working;
+    int i;
+    bool ok;
+
+    fixed_runloop = (argc > 1) && (strcmp(argv[1], "-r") == 0);
+    boot();
+    printf(
+        "DIGITS=%d SLOT_USECS=%lu, %s\n", DIGITS, slot_usecs,
+        fixed_runloop ? "fixed runloop" : "estimated cycle costs");
+
+    // Refresh, with a steady display. All digits differ and there's a DP, so
+    // that's as many rounds as there can be.
+    ok = check_frame(12345678, 0x1, 200);
+    reset_stats();
+    run_for(100000);
+    printf(
+        "refresh: a round every %lu-%luus, longest dark gap: %luus\n",
+        shortest_round, longest_round, longest_gap);
+    printf(
+        "ghost DP: cathode low %.1f%% of the time during non-DP rounds\n",
+        non_dp_usecs ? 100.0 * ghost_usecs / non_dp_usecs : 0.0);
+    if (fixed_runloop) {
+        return ok ? 0 : 1;
+    }
+
+    // Input, from slow to fast, until digits get corrupted. Only periods that
+    // work count towards the worst iterations.
+    memset(&worst, 0, sizeof(worst));
+    for (bit_usecs = 400; bit_usecs >= 10; bit_usecs -= 10) {
+        working = worst;
+        ok = true;
+        for (i = 0; i < 5; i++) {
+            ok &= check_frame(values[i], dotmasks[i], bit_usecs);
+        }
+        if (!ok) {
+            worst = working;
+            break;
+        }
+        shortest_bit = bit_usecs;
+    }
+    printf(
+        "worst display iteration: %lu cycles (%d pin operations)\n",
+        worst.display_cycles, worst.display_pin_ops);
+    printf(
+        "worst input iteration: %lu cycles (%d queued bits)\n",
+        worst.input_cycles, worst.input_bits);
+    printf("shortest working INCLK period: %luus\n", shortest_bit);
+    return shortest_bit ? 0 : 1;
+}
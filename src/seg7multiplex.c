@@ -20,10 +20,77 @@
 #define INCLK PinB2
 #define INSER PinB1
 
+// Pin changes done for each bit sent to the shift registers. On the MCU, they
+// go straight to PORTB, a sbi/cbi each. Going through common/pin.c costs a
+// call and a port lookup every time, which made a round of 8 digits take
+// longer than its slot.
+#ifdef SIMULATION
+#define srclk_low() pinlow(SRCLK)
+#define srclk_high() pinhigh(SRCLK)
+#define rclk_low() pinlow(RCLK)
+#define rclk_high() pinhigh(RCLK)
+#define ser_dp_set(high) pinset(SER_DP, high)
+#else
+#define srclk_low() cbi(PORTB, PB3)
+#define srclk_high() sbi(PORTB, PB3)
+#define rclk_low() cbi(PORTB, PB0)
+#define rclk_high() sbi(PORTB, PB0)
+#define ser_dp_set(high) \
+    do { if (high) sbi(PORTB, PB4); else cbi(PORTB, PB4); } while (0)
+#endif
+
 #define MAX_SER_CYCLES_BEFORE_TIMEOUT 3
 #ifndef DIGITS
 #define DIGITS 4
 #endif
+#if DIGITS > 8
+#error "We can't drive more than 8 digits"
+#endif
+
+// Up to 4 digits, a single SN74HC595 holds both the display mask (low 4 bits)
+// and the glyph (high 4 bits). Beyond that, we daisy-chain a second one: the
+// first holds the display mask and the glyph goes in the high 4 bits of the
+// second.
+#if DIGITS > 4
+#define SR_BITS 16
+typedef uint16_t SRValue;
+#else
+#define SR_BITS 8
+typedef uint8_t SRValue;
+#endif
+#define GLYPH_SHIFT (SR_BITS - 4)
+#define SR_MSB ((SRValue)1 << (SR_BITS - 1))
+// 15 is the "blank" glyph, which we use for DP rounds.
+#define BLANK_GLYPH 15
+
+// One round per glyph, but there can't be more different glyphs than there
+// are digits. Plus one round for DP.
+#define MAX_ROUNDS ((DIGITS < 10 ? DIGITS : 10) + 1)
+// Duration of a refresh slot with a single sub-frame.
+#define ROUND_USECS 600
+// The eye starts seeing flicker at 10ms, but cameras and peripheral vision
+// catch it well before. This is the longest we want a pass over all rounds to
+// take.
+#define MAX_PASS_USECS 4000
+#ifndef SUBFRAMES
+#define SUBFRAMES ((MAX_ROUNDS * ROUND_USECS + MAX_PASS_USECS - 1) / MAX_PASS_USECS)
+#endif
+// Cycles it takes to select a round and send it to the shift registers, which
+// are usecs at F_CPU=1MHz: ~20 per bit and ~120 around them (loop, round
+// selection, latching). These are counted by hand from what
+// perform_display_steps() should compile to (see seg7multiplex_loop()). A slot
+// shorter than that would only mean that rounds come late, so that's our
+// shortest slot.
+#define ROUND_COST_USECS (SR_BITS * 20 + 120)
+#if (ROUND_USECS / SUBFRAMES) < ROUND_COST_USECS
+#define SLOT_USECS ROUND_COST_USECS
+#else
+#define SLOT_USECS (ROUND_USECS / SUBFRAMES)
+#endif
+// ser_timeout counts refresh ticks, which come faster than ROUND_USECS with
+// more digits. Scale it so that the input timeout doesn't depend on DIGITS.
+#define SER_TIMEOUT_TICKS \
+    ((MAX_SER_CYCLES_BEFORE_TIMEOUT * ROUND_USECS + SLOT_USECS - 1) / SLOT_USECS)
 
 /* 7-segments multiplexer
  *
@@ -36,6 +103,22 @@
  * blank glyph). For each glyph, we determine which of the 4 displays should be
  * enabled and set the SN74HC595 to send power the the enabled displays.
  *
+ * Which glyphs are needed, and with which displays, only changes when we
+ * receive a new number, so we build the list of refresh "rounds" as digits
+ * come in, one digit at a time. Refresh ticks then only have to pick the next
+ * round in the list, which is a bounded and constant cost regardless of
+ * DIGITS.
+ *
+ * A frame is the period in which we used to fit one round per glyph, one
+ * round per ROUND_USECS. With more digits, that's more rounds per frame and a
+ * frame rate that falls quickly. So we split the frame into SUBFRAMES
+ * sub-frames, each being a full pass over the rounds with slots that are
+ * SUBFRAMES times shorter. Each digit is thus lit SUBFRAMES times per frame,
+ * interleaved with the rounds of other digits. For 4 digits, a single
+ * sub-frame already keeps us under MAX_PASS_USECS. For 8 digits, we'd use 2,
+ * but a slot can't be shorter than the time it takes to send a round
+ * (ROUND_COST_USECS), so slots are 440us and a pass takes at most 4ms.
+ *
  * The number to display is sent serially through INSER and INCLK.
  *
  * Making the choice of an ATtiny MCU greatly limits our available pins and
@@ -47,8 +130,10 @@
  * All operations are agressively "atomicised" to smal chunks of logic at the
  * cost of increased overall complexity.
  *
- * With this approach, we perform shift register update in 16 atomic steps,
- * each one being performed (if needed) in separate runloop iterations.
+ * With this approach, we perform shift register update in SR_BITS atomic
+ * steps, one per bit. They're all performed in the same runloop iteration
+ * unless input begins, in which case we stop right away and finish the round
+ * later. See seg7multiplex_loop() for the worst case of an iteration.
  *
  * Higher priority is given to the reading of serial data coming through the
  * interrupt. This queue really has to be emptied as fast as possible because
@@ -84,7 +169,13 @@ static uint8_t display_digits[DIGITS] = {1, 8, 2, 1};
 static uint8_t display_dotmask;
 static uint8_t digit_count;
 static uint8_t ser_timeout;
-static uint8_t current_glyph;
+// Display mask for each glyph.
+static SRValue glyph_masks[10];
+// Glyphs, in the order in which they're refreshed. BLANK_GLYPH is the DP round.
+static uint8_t rounds[MAX_ROUNDS];
+static uint8_t round_count;
+static uint8_t current_round;
+static bool dp_round;
 
 // Here, it is assumed that 16 data element is enough to stay clear of "roundtrips", that is, data
 // writing 16 times before we have the change to read anything. The algo using this really must
@@ -97,21 +188,14 @@ typedef struct {
 
 static volatile SerialQueue serial_queue;
 
-// Status of an operation sending an 8-bit value to a shift register, step by step.
-// there are 16 steps, two (clk low, ser+clk high) for each bit.
+// Status of an operation sending a SR_BITS value to a shift register, step by step.
+// there are SR_BITS steps, one (clk low, ser, clk high) for each bit. `val` is
+// shifted as we go, its MSB is the next bit to send.
 typedef struct {
-    uint8_t val;
+    SRValue val;
     uint8_t index;
-    bool going_high;
 } SRValueSender;
 
-typedef enum {
-    SRValueSenderStatus_Beginning, // We've just started and our CLK pin is low.
-    SRValueSenderStatus_Middle, // We're riding.
-    SRValueSenderStatus_Last, // We've just performed our last step. our CLK pin is high.
-    SRValueSenderStatus_Finished, // We don't have anything to send anymore.
-} SRValueSenderStatus;
-
 static SRValueSender sr_sender;
 
 static void serial_queue_init()
@@ -147,100 +231,104 @@ static bool serial_queue_read(bool *data)
     return true;
 }
 
-static void init_sr_sender(uint8_t val)
+static void init_sr_sender(SRValue val)
 {
     sr_sender.val = val;
     sr_sender.index = 0;
-    sr_sender.going_high = false;
 }
 
-// Shift registers usually have CLK minimum delays in the order of 100ns. This algo here assumes
-// that the overhead of calling sr_sender_step() in a runloop results at each call is a delay
-// that is more than sufficient for this required delay.
-static SRValueSenderStatus sr_sender_step()
+
+// Called when we begin receiving a new number.
+static void reset_rounds()
 {
-    SRValueSenderStatus res;
+    uint8_t i;
 
-    if (sr_sender.index < 8) {
-        res = SRValueSenderStatus_Middle;
-        if (sr_sender.going_high) {
-            if (sr_sender.index == 7) {
-                res = SRValueSenderStatus_Last;
-            }
-            pinset(SER_DP, sr_sender.val & (1 << (7 - sr_sender.index)));
-            pinhigh(SRCLK);
-            sr_sender.going_high = false;
-            sr_sender.index++;
-        } else {
-            if (sr_sender.index == 0) {
-                res = SRValueSenderStatus_Beginning;
-            }
-            pinlow(SRCLK);
-            sr_sender.going_high = true;
-        }
-    } else {
-        res = SRValueSenderStatus_Finished;
+    for (i=0; i<10; i++) {
+        glyph_masks[i] = 0;
     }
-    return res;
+    round_count = 0;
+    current_round = 0;
 }
 
-static bool select_next_glyph()
+// Adds digit at `pos` to the rounds. Constant time, so it can be called as
+// digits come in.
+static void add_digit_round(uint8_t pos, uint8_t glyph)
 {
-    // low 4 bits of tosend contain the display mask.
-    // high 4 bits of tosend contain the glyph number.
-    uint8_t tosend = 0;
-    uint8_t i;
-    bool res = false;
-
-    if (current_glyph == 10) {
-        // Round of DP display
-        // 15 is the "blank" glyph.
-        if (display_dotmask) {
-            init_sr_sender(display_dotmask | (15 << 4));
-            res = true;
-        }
-        current_glyph = 0;
-    } else {
-        for (i=0; i<DIGITS; i++) {
-            if (display_digits[i] == current_glyph) {
-                tosend |= (1 << (DIGITS - i - 1));
-            }
-        }
-        if (tosend) {
-            init_sr_sender(tosend | (current_glyph << 4));
-            res = true;
-        }
-        current_glyph++;
+    if (!glyph_masks[glyph]) {
+        rounds[round_count++] = glyph;
     }
-    return res;
+    glyph_masks[glyph] |= (1 << (DIGITS - pos - 1));
 }
 
-// Returns whether we had anything to do at all
-static bool perform_display_step()
+// Digits from `pos` onwards haven't been received, they keep their current
+// value. Then, the DP round goes last. There's always at least one round
+// afterwards because all digits show a glyph.
+static void complete_rounds(uint8_t pos)
 {
-    bool res;
-
-    res = true;
-
-    switch (sr_sender_step()) {
-        case SRValueSenderStatus_Beginning:
-            break;
-        case SRValueSenderStatus_Middle:
-            break;
-        case SRValueSenderStatus_Last:
-            // Only enable DP (low) during the DP round.
-            pinset(SER_DP, current_glyph != 0);
-            // Flush out the buffer with RCLK
-            pinhigh(RCLK);
-            _delay_us(1);
-            pinlow(RCLK); // return to low for OE to be enabled
-            break;
-        case SRValueSenderStatus_Finished:
-            res = false;
-            break;
+    for (; pos<DIGITS; pos++) {
+        add_digit_round(pos, display_digits[pos]);
+    }
+    if (display_dotmask) {
+        rounds[round_count++] = BLANK_GLYPH;
     }
+}
 
-    return res;
+static void select_next_round()
+{
+    uint8_t glyph;
+
+    // low bits of what we send contain the display mask.
+    // high 4 bits of what we send contain the glyph number.
+    glyph = rounds[current_round];
+    dp_round = glyph == BLANK_GLYPH;
+    if (dp_round) {
+        init_sr_sender(display_dotmask | ((SRValue)BLANK_GLYPH << GLYPH_SHIFT));
+    } else {
+        init_sr_sender(glyph_masks[glyph] | ((SRValue)glyph << GLYPH_SHIFT));
+    }
+    current_round++;
+    if (current_round == round_count) {
+        current_round = 0;
+    }
+}
+
+// Sends what's left of the current round. SER_DP is also the DP cathode line,
+// so we never leave it following data bits: if input begins, we stop with
+// SER_DP high and finish the round after the input.
+//
+// Shift registers usually have CLK minimum delays in the order of 100ns. At
+// our clock speeds, a single instruction is already longer than that, so we
+// can go through a whole bit in one step. We work on local copies so that they
+// stay in registers, and we shift `val` rather than testing bit `index`: AVR
+// has no barrel shifter, a variable shift is a loop.
+static void perform_display_steps()
+{
+    SRValue val = sr_sender.val;
+    uint8_t index = sr_sender.index;
+
+    if (index == SR_BITS) {
+        return;
+    }
+    while (index < SR_BITS) {
+        if (input_mode) {
+            ser_dp_set(true);
+            sr_sender.val = val;
+            sr_sender.index = index;
+            return;
+        }
+        srclk_low();
+        ser_dp_set(val & SR_MSB);
+        srclk_high();
+        val <<= 1;
+        index++;
+    }
+    sr_sender.index = index;
+    // Only enable DP (low) during the DP round.
+    ser_dp_set(!dp_round);
+    // Flush out the buffer with RCLK
+    rclk_high();
+    _delay_us(1);
+    rclk_low(); // return to low for OE to be enabled
 }
 
 static void push_digit(uint8_t value)
@@ -256,6 +344,7 @@ static void push_digit(uint8_t value)
 
     if (digit_count < DIGITS) {
         display_digits[digit_count] = value;
+        add_digit_round(digit_count, value);
     }
     digit_count++;
 }
@@ -263,11 +352,12 @@ static void push_digit(uint8_t value)
 static void begin_input_mode()
 {
     input_mode = true;
-    ser_timeout = MAX_SER_CYCLES_BEFORE_TIMEOUT;
+    ser_timeout = SER_TIMEOUT_TICKS;
     digit_count = 0;
     display_dotmask = 0;
     ser_input_pos = 0;
     ser_input = 0;
+    reset_rounds();
 }
 
 static void end_input_mode()
@@ -275,6 +365,7 @@ static void end_input_mode()
     input_mode = false;
     ser_timeout = 0;
     serial_queue_init();
+    complete_rounds(digit_count);
 }
 
 #ifndef SIMULATION
@@ -319,46 +410,94 @@ void seg7multiplex_setup()
 
     input_mode = false;
     serial_queue_init();
-    sr_sender.index = 8; // begin in "finished" mode;
+    sr_sender.index = SR_BITS; // begin in "finished" mode;
     display_dotmask = 0;
     ser_timeout = 0;
-    current_glyph = 0;
+    dp_round = false;
+    reset_rounds();
+    complete_rounds(0);
     refresh_needed = true;
 
     // Set timer that controls refreshes
-    set_timer0_target(600); // every 600 us
+    set_timer0_target(SLOT_USECS);
     set_timer0_mode(TIMER_MODE_INTERRUPT);
 }
 
-void seg7multiplex_loop()
+// Drains the serial queue and decodes what's in it. The queue can't hold more
+// than 8 bits, so this is bounded.
+static void read_serial_input()
 {
     bool flag;
 
+    while (serial_queue_read(&flag)) {
+        if (flag) {
+            ser_input |= (1 << ser_input_pos);
+        }
+        ser_input_pos++;
+        // We've received data, re-init ser_timer countdown
+        ser_timeout = SER_TIMEOUT_TICKS;
+        if (ser_input_pos == 5) {
+            push_digit(ser_input);
+            ser_input = 0;
+            ser_input_pos = 0;
+            if (digit_count == DIGITS) {
+                // We're done here
+                end_input_mode();
+                return;
+            }
+        }
+    }
+}
+
+/* Each loop iteration does, at most:
+ *
+ * 1. Drain the serial queue. This always comes first. Each queued bit costs a
+ *    few shifts and compares. Every 5th bit is a push_digit(), constant time.
+ *    The queue holds at most 7 bits, so that's at most 2 digits.
+ *    begin_input_mode() adds reset_rounds() (10 steps) and end_input_mode()
+ *    adds complete_rounds() (up to DIGITS steps).
+ * 2. Or, when we're not receiving, select_next_round() if the refresh timer
+ *    fired, constant time, and send the SR_BITS bits of the round (3 PORTB
+ *    writes each) followed by SER_DP and the RCLK pulse (3 PORTB writes). If
+ *    input begins during that time, we stop after the current bit.
+ *
+ * sim/timing.c runs this loop against a model of the circuit with estimated
+ * cycle costs ("make timing" in sim). It gives us:
+ *
+ *                              DIGITS=4     DIGITS=8
+ *   worst display iteration    270 cycles   430 cycles
+ *   worst input iteration      300 cycles   250 cycles
+ *   shortest INCLK period      160us        170us
+ *
+ * UNVERIFIED: the costs behind these figures are counted by hand from the C
+ * code (see sim/timing.c), not from the compiled firmware, so they're not a
+ * bound. Until they're checked against "make seg7multiplex.lst" or simavr, the
+ * only INCLK pacing known to work is the one in bench/seg7send.h.
+ *
+ * At F_CPU=1MHz, a cycle is 1us. The length of a display iteration doesn't
+ * limit INCLK: its first edge only sets input_mode and we stop sending the
+ * round after the current bit (~20 cycles). What limits INCLK is that, once
+ * we're receiving, we must drain bits faster than they come in, INT0
+ * included, or the queue wraps around. With the estimates, that's a bit every
+ * ~160us, so an INCLK of ~6kHz. The queue's 7 bits absorb the
+ * begin_input_mode() iteration and jitter.
+ *
+ * A display iteration fits in a slot (ROUND_COST_USECS): rounds come every
+ * 600us for 4 digits and every 430-460us for 8, against 440us slots.
+ */
+void seg7multiplex_loop()
+{
     if (input_mode) {
         if (ser_timeout == 0) {
             // We've just started our input mode set it up
             begin_input_mode();
         }
-        while (serial_queue_read(&flag)) {
-            if (flag) {
-                ser_input |= (1 << ser_input_pos);
-            }
-            ser_input_pos++;
-            // We've received data, re-init ser_timer countdown
-            ser_timeout = MAX_SER_CYCLES_BEFORE_TIMEOUT;
-            if (ser_input_pos == 5) {
-                push_digit(ser_input);
-                ser_input = 0;
-                ser_input_pos = 0;
-                if (digit_count == DIGITS) {
-                    // We're done here
-                    end_input_mode();
-                    // Return now so we don't execute the ser_timeout code
-                    // below. Doing so after end_input_mode() makes
-                    // ser_timeout underflow to 0xff.
-                    return;
-                }
-            }
+        read_serial_input();
+        // Return now if we're done so we don't execute the ser_timeout code
+        // below. Doing so after end_input_mode() makes ser_timeout underflow
+        // to 0xff.
+        if (!input_mode) {
+            return;
         }
         // We don't refresh while we receive serial signal, but we give ourselves a maximum number
         // of cycle before we say "screw that, you're taking too long".
@@ -366,17 +505,17 @@ void seg7multiplex_loop()
             refresh_needed = false;
             ser_timeout--;
             if (ser_timeout == 0) {
-                end_input_mode();
                 // highlight the leftmost dot to indicate error in the previous
                 // reception.
                 display_dotmask = 0x1;
+                end_input_mode();
             }
         }
     } else {
-        while (perform_display_step()) { if (input_mode) return; }
-        if (refresh_needed) {
-            while (!select_next_glyph()){ if (input_mode) return; }
+        if (refresh_needed && (sr_sender.index == SR_BITS)) {
+            select_next_round();
             refresh_needed = false;
         }
+        perform_display_steps();
     }
 }